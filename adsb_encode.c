@@ -2,8 +2,8 @@
 #include <math.h>
 #include <string.h>
 #include <strings.h>
-#include <stdio.h>
 #include "adsb_encode.h"
+#include "trace.h"
 
 # define M_PI       3.14159265358979323846
 /* format
@@ -17,7 +17,15 @@
  * [4-10] DATA (start with TC (5b))
  * [11-13] PI
  */
-int encode_alt_modes(float alt, uint8_t bit13)
+/* used by the one frame functions, read only */
+static const struct adsb_ctx default_ctx = {ADSB_NZ, 0, 4096};
+
+void adsb_ctx_init(struct adsb_ctx *ctx)
+{
+	*ctx = default_ctx;
+}
+
+static int encode_alt_modes(float alt, uint8_t bit13)
 {
 	uint8_t mbit = 0;
 	uint8_t qbit = 1;
@@ -35,28 +43,26 @@ int encode_alt_modes(float alt, uint8_t bit13)
 	return (encalt & 0x0f) | tmp1 | tmp2 | (mbit << 6) | (qbit << 4);
 }
 
-int latz = 15;
-
-int nz(int ctype)
+static int nz(int latz, int ctype)
 {
 	return 4 * latz - ctype;
 }
 
-float dlat(int ctype, uint8_t surface)
+static float dlat(int latz, int ctype, uint8_t surface)
 {
 	float tmp;
 	if (surface == 1)
 		tmp = 90.0f;
 	else
 		tmp = 360.0f;
-	float nzcalc = (float)nz(ctype);
+	float nzcalc = (float)nz(latz, ctype);
 	if (nzcalc == 0)
 		return tmp;
 	else
 		return tmp / nzcalc;
 }
 
-float nl(float declat_in)
+static float nl(int latz, float declat_in)
 {
 	if (fabs(declat_in) >= 87.0f)
 		return 1.0;
@@ -65,19 +71,19 @@ float nl(float declat_in)
 	return floor((2.0 * M_PI) * v2);
 }
 
-float dlon(float declat_in, float ctype, uint8_t surface)
+static float dlon(int latz, float declat_in, float ctype, uint8_t surface)
 {
 	float tmp;
 	if (surface)
 		tmp = 90.0f;
 	else
 		tmp = 360.0f;
-	float nlcalc = fmax(nl(declat_in)-ctype, 1.0f);
+	float nlcalc = fmax(nl(latz, declat_in)-ctype, 1.0f);
 	return tmp / nlcalc;
 }
 
                                                                      // lat       lon
-void cpr_encode(float lat, float lon, float ctype, uint8_t surface, int32_t *yz, int32_t *xz)
+static void cpr_encode(int latz, float lat, float lon, float ctype, uint8_t surface, int32_t *yz, int32_t *xz)
 {
 	float scalar;
 	if (surface)
@@ -86,26 +92,28 @@ void cpr_encode(float lat, float lon, float ctype, uint8_t surface, int32_t *yz,
 		scalar = pow(2, 17);
 
 	// encode using 360 constant for segment size
-	float dlati = dlat(ctype, 0);
+	float dlati = dlat(latz, ctype, 0);
 	float yz_tmp = floor(scalar * ((fmod(lat,dlati))/dlati) + 0.5);
 
 	// encode using 360 constant for segment size
-	float dloni = dlon(lat, ctype, 0);
+	float dloni = dlon(latz, lat, ctype, 0);
 	float xz_tmp = floor(scalar * ((fmod(lon, dloni))/dloni) + 0.5);
 
 	*yz = (int32_t)(yz_tmp) & ((1 << 17)-1);
 	*xz = (int32_t)(xz_tmp) & ((1 << 17)-1);
 }
 
-uint32_t crc(uint8_t *msg)
+uint32_t adsb_crc(const uint8_t *msg, int nbits)
 {
+	TRACE_SCOPE("crc");
 	uint16_t index, offset;
 	uint32_t generator = 0x1FFF409;
+	int len = nbits / 8 - 3; /* data bytes, without PI */
 	uint8_t tmp[14];
-	memcpy(tmp, msg, 11);
-	tmp[11] = tmp[12] = tmp[13] = 0;
+	memcpy(tmp, msg, len);
+	tmp[len] = tmp[len+1] = tmp[len+2] = 0;
 
-	for (index = 0; index < 88; index++) {
+	for (index = 0; index < len * 8; index++) {
 		if ((tmp[index >> 3] & (1 << (7-(index & 0x7)))) != 0) {
 			for (offset = 0; offset < 25; offset++) {
 				/* generator bit */
@@ -122,7 +130,7 @@ uint32_t crc(uint8_t *msg)
 			}
 		}
 	}
-	return (tmp[11] << 16) | (tmp[12] << 8) | tmp[13];
+	return (tmp[len] << 16) | (tmp[len+1] << 8) | tmp[len+2];
 }
 
 /* GGM TODO bin2dec, get_parity */
@@ -131,7 +139,7 @@ uint32_t crc(uint8_t *msg)
  * Encode a byte using Manchester encoding. Returns an array of bits.
  * Adds two start bits (1, 1) and one stop bit (0) to the array.
  */
-uint16_t manchester_encode(uint8_t byte)
+static uint16_t manchester_encode(uint8_t byte)
 {
 	int i;
 	uint16_t tmp;
@@ -143,18 +151,25 @@ uint16_t manchester_encode(uint8_t byte)
 	return tmp;
 }
 
-void df17_pos_rep_encode(uint8_t * df17_even, uint8_t *df17_odd, uint8_t ca, uint32_t icao, uint8_t tc, uint8_t ss, uint8_t nicsb, float alt, uint8_t time,
-					float lat, float lon, uint8_t surface)
+void adsb_encode_position(const struct adsb_ctx *ctx, const struct adsb_position *pos,
+	uint8_t *df17_even, uint8_t *df17_odd)
 {
-	uint8_t format = 17;
+	TRACE_SCOPE("df17_pos_rep_encode");
+	uint8_t format = pos->df;
+	uint8_t ca = pos->ca;
+	uint32_t icao = pos->icao;
+	uint8_t tc = pos->tc;
+	uint8_t ss = pos->ss;
+	uint8_t nicsb = pos->nicsb;
+	uint8_t time = pos->time;
 	uint8_t ff = 0; // cpr off/even flag;
 
-	uint16_t enc_alt =   encode_alt_modes(alt, surface);
+	uint16_t enc_alt =   encode_alt_modes(pos->alt, pos->surface);
 
 	int32_t evenclat, evenclon;
 	int32_t oddclat, oddclon;
-	cpr_encode(lat, lon, 0, surface, &evenclat, &evenclon);
-	cpr_encode(lat, lon, 1, surface, &oddclat, &oddclon);
+	cpr_encode(ctx->nz, pos->lat, pos->lon, 0, pos->surface, &evenclat, &evenclon);
+	cpr_encode(ctx->nz, pos->lat, pos->lon, 1, pos->surface, &oddclat, &oddclon);
 
 	/* since this part is always the same
 	 * maybe set only the first time
@@ -179,7 +194,7 @@ void df17_pos_rep_encode(uint8_t * df17_even, uint8_t *df17_odd, uint8_t ca, uin
 	//	printf("%02x", df17_even[a]);
 	//printf("\n");
 
-	uint32_t checksum = crc(df17_even);
+	uint32_t checksum = adsb_crc(df17_even, 112);
 	//printf("2e019e\n");
 	//printf("%08x\n", checksum);
 	df17_even[11] = (checksum >> 16) & 0xff;
@@ -197,7 +212,7 @@ void df17_pos_rep_encode(uint8_t * df17_even, uint8_t *df17_odd, uint8_t ca, uin
 	df17_odd[10] = oddclon & 0xff;
 	
 
-	checksum = crc(df17_odd);
+	checksum = adsb_crc(df17_odd, 112);
 	df17_odd[11] = (checksum >> 16) & 0xff;
 	df17_odd[12] = (checksum >> 8) & 0xff;
 	df17_odd[13] = checksum & 0xff;
@@ -205,8 +220,27 @@ void df17_pos_rep_encode(uint8_t * df17_even, uint8_t *df17_odd, uint8_t ca, uin
 	/* TODO: to complete */
 }
 
+void df17_pos_rep_encode(uint8_t * df17_even, uint8_t *df17_odd, uint8_t ca, uint32_t icao, uint8_t tc, uint8_t ss, uint8_t nicsb, float alt, uint8_t time,
+					float lat, float lon, uint8_t surface)
+{
+	struct adsb_position pos = {icao, lat, lon, alt, 17, ca, tc, ss, nicsb, time, surface};
+	adsb_encode_position(&default_ctx, &pos, df17_even, df17_odd);
+}
+
+int adsb_encode_positions(const struct adsb_ctx *ctx, const struct adsb_position *pos, size_t n,
+	uint8_t *frames, size_t frames_len)
+{
+	size_t i;
+	if (frames_len < n * 2 * ADSB_FRAME_BYTES)
+		return -1;
+	for (i = 0; i < n; i++, frames += 2 * ADSB_FRAME_BYTES)
+		adsb_encode_position(ctx, &pos[i], frames, frames + ADSB_FRAME_BYTES);
+	return n * 2;
+}
+
 void frame_1090es_ppm_modulate(uint8_t *even, uint8_t *odd, uint8_t *ppm)
 {
+	TRACE_SCOPE("ppm_modulate");
 	int i;
 	int start = 48; // pause
 	ppm[start++] = 0xA1;
@@ -244,13 +278,16 @@ void frame_1090es_ppm_modulate(uint8_t *even, uint8_t *odd, uint8_t *ppm)
  * 0-9 -> 48 - 57
  * _   -> 32
  */
-void adsb_airCraftIdent(int16_t *buffer, uint32_t icao, uint8_t ec, uint8_t ca, uint8_t tc, uint8_t *name)
+int adsb_encode_ident(const struct adsb_ctx *ctx, const struct adsb_ident *id, uint8_t *msg)
 {
-	int i;
+	int i, unsupported = 0;
 	char c;
-	tc = 1;
-	uint8_t format = 17;
-	uint8_t msg[14];
+	uint8_t tc = 1;
+	uint8_t format = id->df;
+	uint8_t ca = id->ca;
+	uint8_t ec = id->ec;
+	uint32_t icao = id->icao;
+	const uint8_t *name = id->name;
 	uint8_t codeName[8];
 	for (i=0; i < 8; i++) {
 		c = name[i];
@@ -263,7 +300,7 @@ void adsb_airCraftIdent(int16_t *buffer, uint32_t icao, uint8_t ec, uint8_t ca,
 		} else if (c >= 0x41 && c < 0x5A) { // A-Z
 			c -= 0x40;
 		} else {
-			printf("not supported char %02x\n", c);
+			unsupported++;
 			c = 32;
 		}
 		codeName[i] = c;
@@ -287,22 +324,47 @@ void adsb_airCraftIdent(int16_t *buffer, uint32_t icao, uint8_t ec, uint8_t ca,
 	//          [1:0]                 [5:0]
 	msg[10] = (codeName[6] << 6) | (codeName[7] & 0x3F);
 
-	uint32_t checksum = crc(msg);
+	uint32_t checksum = adsb_crc(msg, 112);
 	msg[11] = (checksum >> 16) & 0xff;
 	msg[12] = (checksum >> 8) & 0xff;
 	msg[13] = checksum & 0xff;
+	return unsupported;
+}
+
+int adsb_ident_encode(uint8_t *msg, uint32_t icao, uint8_t ec, uint8_t ca, uint8_t tc, uint8_t *name)
+{
+	struct adsb_ident id = {icao, 17, ca, ec, {0}};
+	memcpy(id.name, name, 8);
+	return adsb_encode_ident(&default_ctx, &id, msg);
+}
+
+int adsb_encode_idents(const struct adsb_ctx *ctx, const struct adsb_ident *id, size_t n,
+	uint8_t *frames, size_t frames_len)
+{
+	size_t i;
+	if (frames_len < n * ADSB_FRAME_BYTES)
+		return -1;
+	for (i = 0; i < n; i++, frames += ADSB_FRAME_BYTES)
+		adsb_encode_ident(ctx, &id[i], frames);
+	return n;
+}
+
+int adsb_airCraftIdent(int16_t *buffer, uint32_t icao, uint8_t ec, uint8_t ca, uint8_t tc, uint8_t *name)
+{
+	uint8_t msg[14];
+	int unsupported = adsb_ident_encode(msg, icao, ec, ca, tc, name);
 
 	uint8_t df17_array[256];
 	bzero(df17_array, 256);
 	frame_1090es_ppm_modulate(msg, NULL, df17_array);
 
 	prepare_to_send(df17_array, 256, 0, 4096, buffer);
-
-
+	return unsupported;
 }
 
 void prepare_to_send(uint8_t *rawframe, int length, int16_t min, int16_t max, int16_t *out)
 {
+	TRACE_SCOPE("prepare_to_send");
 	int i, ii;
 	/* convert bit to I/Q values */
 	int size = 256 * 8;
@@ -319,6 +381,115 @@ void prepare_to_send(uint8_t *rawframe, int length, int16_t min, int16_t max, in
 	}
 }
 
+int adsb_frame_bits(const uint8_t *frame)
+{
+	/* DF 0-15 are short (56 bits) frames, DF 16-24 long (112 bits) */
+	return (frame[0] & 0x80) ? 112 : 56;
+}
+
+int adsb_modulate_frame(const uint8_t *frame, int nbits, int16_t min, int16_t max, int16_t *out)
+{
+	TRACE_SCOPE("modulate_frame");
+	/* pulses at 0, 1, 3.5 and 4.5 us */
+	const uint16_t preamble = 0xA140;
+	int i, ii = 0;
+	int16_t first, second;
+
+	for (i = 15; i >= 0; i--, ii += 2) {
+		first = ((preamble >> i) & 0x01) ? max : min;
+		out[ii] = first;
+		out[ii+1] = first;
+	}
+	/* 1 -> high then low, 0 -> low then high */
+	for (i = 0; i < nbits; i++, ii += 4) {
+		if ((frame[i >> 3] & (1 << (7 - (i & 0x7)))) != 0) {
+			first = max;
+			second = min;
+		} else {
+			first = min;
+			second = max;
+		}
+		out[ii] = first;
+		out[ii+1] = first;
+		out[ii+2] = second;
+		out[ii+3] = second;
+	}
+	return ADSB_FRAME_SAMPLES(nbits);
+}
+
+int adsb_frame_chips(const uint8_t *frame, int nbits, uint8_t *chips)
+{
+	const uint16_t preamble = 0xA140;
+	int i, ii = 0;
+
+	for (i = 15; i >= 0; i--)
+		chips[ii++] = (preamble >> i) & 0x01;
+	for (i = 0; i < nbits; i++) {
+		uint8_t bit = (frame[i >> 3] >> (7 - (i & 0x7))) & 0x01;
+		chips[ii++] = bit;
+		chips[ii++] = bit ^ 0x01;
+	}
+	return ii;
+}
+
+void adsb_render_frame(const uint8_t *frame, int nbits, double start, float amp,
+	int16_t *out, int64_t out_start, int out_len)
+{
+	TRACE_SCOPE("render_frame");
+	uint8_t chips[ADSB_FRAME_SAMPLES(112)];
+	int len = adsb_frame_chips(frame, nbits, chips);
+	int64_t s0 = (int64_t)floor(start);
+	float frac = (float)(start - s0);
+	int j, first, last;
+
+	/* clip to [out_start, out_start + out_len) */
+	if (s0 + len + 1 <= out_start || s0 >= out_start + out_len)
+		return;
+	first = (out_start > s0) ? (int)(out_start - s0) : 0;
+	last = (s0 + len + 1 > out_start + out_len) ? (int)(out_start + out_len - s0) : len + 1;
+
+	/* sample s0 + j overlaps chip j by (1 - frac) and chip j - 1 by frac */
+	for (j = first; j < last; j++) {
+		float v = 0;
+		if (j < len && chips[j])
+			v += 1.0f - frac;
+		if (j > 0 && chips[j-1])
+			v += frac;
+		if (v == 0)
+			continue;
+		int16_t *s = out + 2 * (s0 + j - out_start);
+		int32_t acc = s[0] + lrintf(amp * v);
+		if (acc > INT16_MAX)
+			acc = INT16_MAX;
+		s[0] = acc;
+		s[1] = acc;
+	}
+}
+
+long adsb_modulate_frames(const struct adsb_ctx *ctx, const uint8_t *frames, size_t n, int gap,
+	int16_t *iq, size_t iq_len)
+{
+	TRACE_SCOPE("modulate_frames");
+	size_t i;
+	long pos = 0;
+	int nbits;
+
+	/* check the whole batch first, nothing is written if it doesn't fit */
+	for (i = 0; i < n; i++)
+		pos += ADSB_FRAME_SAMPLES(adsb_frame_bits(frames + i * ADSB_FRAME_BYTES)) + gap;
+	if ((size_t)pos * 2 > iq_len)
+		return -1;
+
+	memset(iq, 0, pos * 2 * sizeof(int16_t));
+	pos = 0;
+	for (i = 0; i < n; i++, frames += ADSB_FRAME_BYTES) {
+		nbits = adsb_frame_bits(frames);
+		pos += adsb_modulate_frame(frames, nbits, ctx->min, ctx->max, iq + 2 * pos);
+		pos += gap;
+	}
+	return pos;
+}
+
 void adsb_encode(int16_t *buffer, uint32_t icao, float lat, float lon, float alt, uint8_t ca, uint8_t tc,
 	uint8_t ss, uint8_t nicsb, uint8_t time, uint8_t surface)
 {
@@ -1,10 +1,114 @@
 #ifndef __ADSB_ENCODE_H__
 #define __ADSB_ENCODE_H__
 
+#include <stdint.h>
+#include <stddef.h>
+
+/* reentrant: no global state, every function only uses its arguments and
+ * the context (read only), so one context may be shared between threads.
+ * Functions without a context use the default one.
+ */
+
+/* number of latitude zones for CPR */
+#define ADSB_NZ 15
+/* one frame slot in batch buffers: 112 bits, 56 bits frames use 7 bytes */
+#define ADSB_FRAME_BYTES 14
+
+/* at 2 MS/s: 8us preamble and 1us (2 chips) per bit */
+#define ADSB_PREAMBLE_SAMPLES 16
+#define ADSB_SAMPLES_PER_BIT 2
+#define ADSB_FRAME_SAMPLES(nbits) (ADSB_PREAMBLE_SAMPLES + (nbits) * ADSB_SAMPLES_PER_BIT)
+
+struct adsb_ctx {
+	int nz;          /* CPR latitude zones */
+	int16_t min;     /* IQ value of a low chip */
+	int16_t max;     /* IQ value of a high chip */
+};
+
+/* airborne/surface position report */
+struct adsb_position {
+	uint32_t icao;
+	float lat, lon, alt;
+	uint8_t df;      /* 17 or 18 */
+	uint8_t ca;      /* CA for DF17, CF for DF18 */
+	uint8_t tc, ss, nicsb, time, surface;
+};
+
+/* aircraft identification */
+struct adsb_ident {
+	uint32_t icao;
+	uint8_t df;      /* 17 or 18 */
+	uint8_t ca;      /* CA for DF17, CF for DF18 */
+	uint8_t ec;      /* emitter category */
+	uint8_t name[8]; /* A-Z 0-9 _ */
+};
+
+/* default context: NZ 15, IQ levels 0 and 4096 */
+void adsb_ctx_init(struct adsb_ctx *ctx);
+
+/* CRC (PI field) of a 56 or 112 bits frame */
+uint32_t adsb_crc(const uint8_t *msg, int nbits);
+
+/* encode one position report to an even and an odd 14B frame */
+void adsb_encode_position(const struct adsb_ctx *ctx, const struct adsb_position *pos,
+	uint8_t *even, uint8_t *odd);
+/* encode one identification to a 14B frame
+ * return the number of unsupported chars in name (sent as space)
+ */
+int adsb_encode_ident(const struct adsb_ctx *ctx, const struct adsb_ident *id, uint8_t *msg);
+
+/* batch versions: frames is a contiguous buffer of frames_len bytes
+ * receiving one ADSB_FRAME_BYTES slot per frame (even then odd for
+ * positions)
+ * return the number of frames written, -1 if frames is too small
+ */
+int adsb_encode_positions(const struct adsb_ctx *ctx, const struct adsb_position *pos, size_t n,
+	uint8_t *frames, size_t frames_len);
+int adsb_encode_idents(const struct adsb_ctx *ctx, const struct adsb_ident *id, size_t n,
+	uint8_t *frames, size_t frames_len);
+
+/* modulate n frames (ADSB_FRAME_BYTES slots, length given by their DF)
+ * back to back, each followed by gap silent samples, into iq which holds
+ * iq_len int16 (I/Q interleaved)
+ * return the number of samples written, -1 if iq is too small
+ */
+long adsb_modulate_frames(const struct adsb_ctx *ctx, const uint8_t *frames, size_t n, int gap,
+	int16_t *iq, size_t iq_len);
+
 /* buffer must have a size of 4096 */
 void adsb_encode(int16_t *buffer, uint32_t icao, float lat, float lon, float alt,
 	uint8_t ca, uint8_t tc, uint8_t ss, uint8_t nicsb, uint8_t time, uint8_t surface);
-void adsb_airCraftIdent(int16_t *buffer, uint32_t icao, uint8_t ec, uint8_t ca, uint8_t tc, uint8_t *name);
+/* return the number of unsupported chars in name (sent as space) */
+int adsb_airCraftIdent(int16_t *buffer, uint32_t icao, uint8_t ec, uint8_t ca, uint8_t tc, uint8_t *name);
+
+/* frame only (14B) versions of the two above, no modulation */
+void df17_pos_rep_encode(uint8_t *df17_even, uint8_t *df17_odd, uint8_t ca, uint32_t icao, uint8_t tc,
+	uint8_t ss, uint8_t nicsb, float alt, uint8_t time, float lat, float lon, uint8_t surface);
+int adsb_ident_encode(uint8_t *msg, uint32_t icao, uint8_t ec, uint8_t ca, uint8_t tc, uint8_t *name);
+
+/* frame length in bits (56 or 112) given by its DF */
+int adsb_frame_bits(const uint8_t *frame);
+
+/* modulate a 56 or 112 bits frame (preamble + PPM), without pause
+ * out buffer must have :
+ * ADSB_FRAME_SAMPLES(nbits) * 2 (I/Q)
+ * return number of samples written
+ */
+int adsb_modulate_frame(const uint8_t *frame, int nbits, int16_t min, int16_t max, int16_t *out);
+
+/* expand a frame to chips (1 per sample, 0 or 1), preamble included
+ * chips must have room for ADSB_FRAME_SAMPLES(nbits)
+ * return number of chips
+ */
+int adsb_frame_chips(const uint8_t *frame, int nbits, uint8_t *chips);
+
+/* add a frame starting at the fractional sample position start, with
+ * amplitude amp, to out which holds samples [out_start, out_start + out_len)
+ * of the stream. Chips edges falling between two samples are linearly
+ * shared between them; the part of the frame outside out is dropped.
+ */
+void adsb_render_frame(const uint8_t *frame, int nbits, double start, float amp,
+	int16_t *out, int64_t out_start, int out_len);
 
 /* convert trame to manchester
  * odd may be NULL
@@ -0,0 +1,173 @@
+#include <string.h>
+#include "adsb_encode.h"
+#include "iq_packer.h"
+#include "trace.h"
+
+void iq_packer_init(struct iq_packer *p, int16_t *buf, int nsamples, int gap,
+	int16_t amplitude, iq_send_t send, void *priv)
+{
+	p->buf = buf;
+	p->nsamples = nsamples;
+	p->gap = gap;
+	p->amplitude = amplitude;
+	p->base = 0;
+	p->next = 0;
+	p->frames = 0;
+	p->total = 0;
+	p->busy = 0;
+	p->last = 0;
+	p->ncarry = 0;
+	p->lo = 0;
+	p->hi = 0;
+	p->nspans = 0;
+	p->send = send;
+	p->priv = priv;
+	p->sparse = NULL;
+}
+
+void iq_packer_set_sparse(struct iq_packer *p, struct sparse_writer *w)
+{
+	p->sparse = w;
+}
+
+static struct iq_span *iq_packer_span(struct iq_packer *p, int16_t *buf)
+{
+	int i;
+	for (i = 0; i < p->nspans; i++) {
+		if (p->spans[i].buf == buf)
+			return &p->spans[i];
+	}
+	if (p->nspans == IQ_PACKER_BUFFERS)
+		return NULL;
+	/* first time seen, content unknown */
+	p->spans[p->nspans].buf = buf;
+	p->spans[p->nspans].lo = 0;
+	p->spans[p->nspans].hi = p->nsamples;
+	return &p->spans[p->nspans++];
+}
+
+void iq_packer_dirty(struct iq_packer *p, int lo, int hi)
+{
+	if (hi > p->nsamples)
+		hi = p->nsamples;
+	if (p->lo == p->hi) {
+		p->lo = lo;
+		p->hi = hi;
+		return;
+	}
+	if (lo < p->lo)
+		p->lo = lo;
+	if (hi > p->hi)
+		p->hi = hi;
+}
+
+/* send n samples of the current buffer, whatever its content */
+static int iq_packer_send(struct iq_packer *p, int n)
+{
+	struct iq_span *span;
+	int16_t *sent = p->buf;
+
+	TRACE_SCOPE("packer_send");
+	if (p->sparse) {
+		p->base += n;
+		p->frames = (p->ncarry > 0) ? 1 : 0;
+		p->ncarry = 0;
+		return 0;
+	}
+	p->buf = p->send(p->priv, p->buf, n);
+	if (p->buf == NULL)
+		return -1;
+
+	/* remember what was written in the buffer sent, then clear only
+	 * that part of the one to fill (may be the same)
+	 */
+	span = iq_packer_span(p, sent);
+	if (span) {
+		span->lo = p->lo;
+		span->hi = p->hi;
+	}
+	span = iq_packer_span(p, p->buf);
+	if (span) {
+		if (span->hi > span->lo)
+			memset(p->buf + 2 * span->lo, 0, (span->hi - span->lo) * 2 * sizeof(int16_t));
+		span->lo = 0;
+		span->hi = 0;
+	} else {
+		memset(p->buf, 0, p->nsamples * 2 * sizeof(int16_t));
+	}
+	p->lo = 0;
+	p->hi = 0;
+	p->base += n;
+	p->frames = 0;
+	/* end of a frame started in the previous buffer */
+	if (p->ncarry > 0) {
+		memcpy(p->buf, p->carry, p->ncarry * 2 * sizeof(int16_t));
+		iq_packer_dirty(p, 0, p->ncarry);
+		p->ncarry = 0;
+		p->frames = 1;
+	}
+	return 0;
+}
+
+int iq_packer_add_at(struct iq_packer *p, uint64_t at, uint8_t *frame, int nbits)
+{
+	int len = ADSB_FRAME_SAMPLES(nbits);
+	uint64_t start;
+
+	if (at < p->next)
+		at = p->next;
+	/* silent buffers are sent up to the frame start */
+	while (1) {
+		start = (at > p->base) ? at : p->base;
+		if (start < p->base + p->nsamples)
+			break;
+		if (iq_packer_send(p, p->nsamples) < 0)
+			return -1;
+	}
+
+	if (p->sparse) {
+		if (sparse_writer_add(p->sparse, start, p->amplitude, frame, nbits) < 0)
+			return -1;
+		/* only the length, to keep the same stream length as IQ */
+		if (start + len > p->base + p->nsamples)
+			p->ncarry = start + len - (p->base + p->nsamples);
+	} else if (start + len <= p->base + p->nsamples) {
+		adsb_modulate_frame(frame, nbits, 0, p->amplitude, p->buf + 2 * (start - p->base));
+	} else {
+		/* across two buffers, the end goes to the next one */
+		int16_t tmp[ADSB_FRAME_SAMPLES(112) * 2];
+		int head = p->base + p->nsamples - start;
+		adsb_modulate_frame(frame, nbits, 0, p->amplitude, tmp);
+		memcpy(p->buf + 2 * (start - p->base), tmp, head * 2 * sizeof(int16_t));
+		memcpy(p->carry, tmp + 2 * head, (len - head) * 2 * sizeof(int16_t));
+		p->ncarry = len - head;
+	}
+	if (!p->sparse)
+		iq_packer_dirty(p, start - p->base, start - p->base + len);
+	p->next = start + len + p->gap;
+	p->last = start;
+	p->frames++;
+	p->total++;
+	p->busy += len;
+	return 0;
+}
+
+int iq_packer_add(struct iq_packer *p, uint8_t *frame, int nbits)
+{
+	return iq_packer_add_at(p, 0, frame, nbits);
+}
+
+int iq_packer_flush(struct iq_packer *p)
+{
+	/* twice if the last frame runs over the buffer */
+	while (p->frames > 0) {
+		if (iq_packer_send(p, p->nsamples) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int iq_packer_push(struct iq_packer *p, int n)
+{
+	return iq_packer_send(p, n);
+}
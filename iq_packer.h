@@ -0,0 +1,87 @@
+#ifndef __IQ_PACKER_H__
+#define __IQ_PACKER_H__
+
+#include <stdint.h>
+#include "adsb_encode.h"
+#include "sparse.h"
+
+/* pack modulated frames back to back into IQ buffers
+ *
+ * frames are appended to the current buffer, separated only by the
+ * minimum inter-frame gap. When the buffer is full, it is handed to send()
+ * and the packer continues in the buffer it returns; a frame running over
+ * the end of a buffer continues at the start of the next one.
+ *
+ * only the samples written since a buffer was last sent (its dirty span)
+ * are cleared when it comes back from send(): the packer keeps the dirty
+ * span of every buffer it has seen, so the IIO kernel buffers, which are
+ * reused in turn, or the output buffer are never fully rewritten.
+ *
+ * with a sparse writer attached, frames are recorded as events at the same
+ * stream positions and nothing is modulated nor sent.
+ */
+
+/* send nsamples I/Q pairs from buf
+ * return the next buffer to fill (may be buf) or NULL on error
+ */
+typedef int16_t *(*iq_send_t)(void *priv, int16_t *buf, int nsamples);
+
+/* buffers (ie. IIO kernel buffers) whose dirty span is tracked */
+#define IQ_PACKER_BUFFERS 16
+
+struct iq_span {
+	int16_t *buf;
+	int lo, hi;           /* dirty samples [lo, hi) */
+};
+
+struct iq_packer {
+	int16_t *buf;         /* current buffer, nsamples I/Q pairs */
+	int nsamples;
+	int gap;              /* minimum inter-frame gap in samples */
+	int16_t amplitude;
+	uint64_t base;        /* stream position of buf[0] */
+	uint64_t next;        /* first stream position a frame may start at */
+	int frames;           /* frames in the current buffer */
+	uint64_t total;       /* frames packed since init */
+	uint64_t busy;        /* samples occupied by frames since init */
+	uint64_t last;        /* stream position of the last frame */
+	int16_t carry[ADSB_FRAME_SAMPLES(112) * 2]; /* end of a frame for the next buffer */
+	int ncarry;
+	int lo, hi;           /* dirty samples of buf */
+	struct iq_span spans[IQ_PACKER_BUFFERS];
+	int nspans;
+	iq_send_t send;
+	void *priv;
+	struct sparse_writer *sparse;
+};
+
+/* buf must be zeroed */
+void iq_packer_init(struct iq_packer *p, int16_t *buf, int nsamples, int gap,
+	int16_t amplitude, iq_send_t send, void *priv);
+/* record events in w instead of filling buffers */
+void iq_packer_set_sparse(struct iq_packer *p, struct sparse_writer *w);
+/* append a 56 or 112 bits frame
+ * return 0 on success, -1 if send() fails
+ */
+int iq_packer_add(struct iq_packer *p, uint8_t *frame, int nbits);
+/* same, but the frame starts at stream position at, or as soon as
+ * possible after it; silent buffers are sent up to it
+ */
+int iq_packer_add_at(struct iq_packer *p, uint64_t at, uint8_t *frame, int nbits);
+/* send the current buffer if it holds at least one frame (and the next
+ * one if the last frame runs over)
+ * return 0 on success, -1 if send() fails
+ */
+int iq_packer_flush(struct iq_packer *p);
+
+/* for frames written to buf by the caller (ie. rendered from a sparse
+ * file): mark samples [lo, hi) of buf as written
+ */
+void iq_packer_dirty(struct iq_packer *p, int lo, int hi);
+/* send the first n samples of buf, whatever its content, and continue in
+ * the next buffer at base + n
+ * return 0 on success, -1 if send() fails
+ */
+int iq_packer_push(struct iq_packer *p, int n);
+
+#endif /* __IQ_PACKER_H__ */
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <getopt.h>
 #include <errno.h>
 #include <signal.h>
@@ -11,6 +12,12 @@
 #include <time.h>
 
 #include "adsb_encode.h"
+#include "iq_packer.h"
+#include "mlat.h"
+#include "replay_index.h"
+#include "sparse.h"
+#include "stress.h"
+#include "trace.h"
 
 #define NOTUSED(V) ((void) V)
 #define MHZ(x) ((long long)(x*1000000.0 + .5))
@@ -18,6 +25,8 @@
 //#define NUM_SAMPLES 2600000
 #define NUM_SAMPLES 2048
 #define BUFFER_SIZE (NUM_SAMPLES * 2 * sizeof(int16_t))
+#define SAMPLES_PER_US 2
+#define DEFAULT_GAP_US 4
 
 
 struct stream_cfg {
@@ -32,12 +41,23 @@ static void usage() {
     fprintf(stderr, "Usage: pluto-adsb-sim [options]\n"
 		"  -h                 This help\n"
         "  -t <filename>      Transmit data from file\n"
+        "  -B <start>         With -t, start at the first line dated <start> (file time unit)\n"
+        "  -E <end>           With -t, stop after the last line dated <end>\n"
 		"  -o <outfile>       Write to file instead of using PlutoSDR\n"
         "  -a <attenuation>   Set TX attenuation [dB] (default -20.0)\n"
         "  -b <bw>            Set RF bandwidth [MHz] (default 5.0)\n"
         "  -f <freq>          Set RF center frequency [MHz] (default 868.0)\n"
         "  -u <uri>           ADALM-Pluto URI\n"
         "  -n <network>       ADALM-Pluto network IP or hostname (default pluto.local)\n"
+        "  -g <gap>           Minimum inter-frame gap [us] (default 4)\n"
+        "  -S                 Write a sparse event file with -o instead of IQ\n"
+        "  -x <sparsefile>    Transmit (or write with -o) IQ expanded from a sparse file\n"
+        "  -R <rate>[:<end>]  Stress mode: synthetic traffic at <rate> msg/s, ramping to <end>\n"
+        "  -D <duration>      Stress mode duration [s] (default 10)\n"
+        "  -P <pool>          Stress mode number of aircraft (default 1000)\n"
+        "  -m <manifest>      Stress mode ground truth of every frame sent (CSV)\n"
+        "  -M <sitefile>      Render one output file per MLAT receiver site (needs -o)\n"
+        "  -T <tracefile>     Write a Chrome trace (Perfetto) JSON file at exit\n"
 	    "  -i <ICAO>\n"
 	    "  -l <Latitude>\n"
 	    "  -L <Longitude>\n"
@@ -54,6 +74,95 @@ static void handle_sig(int sig)
     stop = true;
 }
 
+/* ******************** */
+/* send packed buffers  */
+/* ******************** */
+
+struct tx_output {
+	struct iio_buffer *tx_buffer; /* NULL when writing to fout */
+	FILE *fout;
+	long long samples;            /* IQ samples sent */
+};
+
+/* iq_packer send callback: push to PlutoSDR or write to file */
+static int16_t *tx_send(void *priv, int16_t *buf, int nsamples)
+{
+	struct tx_output *out = (struct tx_output *)priv;
+
+	if (out->tx_buffer != NULL) {
+		TRACE_BEGIN(push, "iio_buffer_push");
+		ssize_t ntx = iio_buffer_push(out->tx_buffer);
+		TRACE_END(push);
+		if (ntx < 0) {
+			printf("Error pushing buf %d\n", (int) ntx);
+			return NULL;
+		}
+		buf = (int16_t *)iio_buffer_start(out->tx_buffer);
+	} else {
+		TRACE_BEGIN(wr, "fwrite");
+		size_t nw = fwrite(buf, 2 * sizeof(int16_t), nsamples, out->fout);
+		TRACE_END(wr);
+		if (nw != (size_t)nsamples) {
+			printf("Error: fail to write output file\n");
+			return NULL;
+		}
+	}
+	out->samples += nsamples;
+	TRACE_COUNTER("samples", out->samples);
+	return buf;
+}
+
+/* ********************** */
+/* MLAT frame source      */
+/* ********************** */
+
+/* the pseudo signal aircraft, as seen by MLAT receivers */
+struct mlat_aircraft {
+	uint32_t icao;
+	float lat, lon, alt;
+	int direction;
+	uint8_t *name;
+	int gap;         /* in samples */
+	uint64_t next;   /* stream position of the next report */
+	uint64_t period; /* samples between reports */
+};
+
+/* one position (even/odd) and identification per period, as the fake
+ * signal loop does every second; nothing in a block with no report due
+ */
+static int mlat_aircraft_block(void *priv, uint64_t base, struct mlat_frame *frames, int max)
+{
+	TRACE_SCOPE("mlat_encode");
+	struct mlat_aircraft *a = (struct mlat_aircraft *)priv;
+	double ecef[3];
+	int i, n = 0;
+
+	while (a->next < base + MLAT_BLOCK_SAMPLES) {
+		if (n + 3 > max)
+			return -1;
+		df17_pos_rep_encode(frames[n].msg, frames[n + 1].msg, 5, a->icao, 11, 0, 0, a->alt, 0,
+			a->lat, a->lon, 0);
+		adsb_ident_encode(frames[n + 2].msg, a->icao, 0, 5, 11, a->name);
+
+		/* altitude in feet */
+		mlat_geodetic_to_ecef(a->lat, a->lon, a->alt * 0.3048, ecef);
+		for (i = 0; i < 3; i++) {
+			frames[n + i].nbits = 112;
+			frames[n + i].t = a->next + i * (ADSB_FRAME_SAMPLES(112) + a->gap);
+			memcpy(frames[n + i].ecef, ecef, sizeof(ecef));
+		}
+		n += 3;
+
+		if (a->alt == 10000 && a->direction == 100)
+			a->direction = -100;
+		else if (a->alt == 100 && a->direction == -100)
+			a->direction = 100;
+		a->alt += a->direction;
+		a->next += a->period;
+	}
+	return n;
+}
+
 /* ********************** */
 /* read trame from a file */
 /* ********************** */
@@ -104,6 +213,45 @@ void parseline(char *line, int length, uint64_t *date, uint8_t *trame)
 	}
 }
 
+/* seek fp to a line dated before tstart, from which every line dated
+ * tstart or later follows. A saved index may still be stale (file
+ * rewritten in place): the line found is checked, and the index rebuilt
+ * if it doesn't fit.
+ * return 0 on success, -1 on error
+ */
+static int replay_seek(FILE *fp, const char *path, uint64_t tstart)
+{
+	struct replay_index *idx;
+	uint64_t offset, date;
+	char line[64];
+	int pass, ok;
+
+	for (pass = 0; pass < 2; pass++) {
+		idx = replay_index_open(path, pass > 0);
+		if (idx == NULL)
+			return -1;
+		offset = replay_index_seek(idx, tstart);
+		printf("Start at %llx: offset %llu (%llu lines, %llx to %llx)\n",
+			(unsigned long long)tstart, (unsigned long long)offset,
+			(unsigned long long)idx->hdr.nlines,
+			(unsigned long long)idx->hdr.first, (unsigned long long)idx->hdr.last);
+		replay_index_close(idx);
+		if (fseeko(fp, offset, SEEK_SET) != 0)
+			break;
+		/* the start of the file is always fine */
+		ok = (offset == 0) ||
+			(fgets(line, sizeof(line), fp) != NULL && line[0] == '@' &&
+			sscanf(line + 1, "%12" SCNx64, &date) == 1 && date < tstart);
+		if (fseeko(fp, offset, SEEK_SET) != 0)
+			break;
+		if (ok)
+			return 0;
+		printf("Warning: stale index for %s\n", path);
+	}
+	fprintf(stderr, "ERROR: Failed to seek TX file: %s\n", path);
+	return -1;
+}
+
 /*
  * 
  */
@@ -130,6 +278,19 @@ int main(int argc, char** argv) {
 	uint8_t *name = NULL;
 
 	const char *outfile = NULL;
+	const char *tracefile = NULL;
+	const char *sitefile = NULL;
+	const char *sparsefile = NULL;
+	const char *manifest = NULL;
+	uint64_t tstart = 0, tend = UINT64_MAX;
+	bool sparse = false;
+	struct sparse_writer *sparse_out = NULL;
+	struct sparse_reader *sparse_in = NULL;
+	struct stress_cfg stress = {0, 0, 10.0, 1000, 0, 0, 0, NULL};
+	int gap = DEFAULT_GAP_US;
+	int status = EXIT_SUCCESS;
+	struct tx_output output = {NULL, NULL, 0};
+	struct iq_packer packer;
 	FILE *fout = NULL;
     
     struct iio_context *ctx = NULL;
@@ -139,11 +300,17 @@ int main(int argc, char** argv) {
     struct iio_channel *tx0_q = NULL;
     struct iio_buffer *tx_buffer = NULL;    
     
-    while ((opt = getopt(argc, argv, "ht:a:b:n:u:f:i:l:L:A:o:")) != EOF) {
+    while ((opt = getopt(argc, argv, "ht:B:E:a:b:n:u:f:i:l:L:A:I:o:g:Sx:R:D:P:m:M:T:")) != EOF) {
         switch (opt) {
             case 't':
                 path = optarg;
                 break;
+			case 'B':
+				tstart = strtoull(optarg, NULL, 0);
+				break;
+			case 'E':
+				tend = strtoull(optarg, NULL, 0);
+				break;
             case 'a':
                 txcfg.gain_db = atof(optarg);
                 if(txcfg.gain_db > 0.0) txcfg.gain_db = 0.0;
@@ -181,6 +348,38 @@ int main(int argc, char** argv) {
 			case 'o':
 				outfile = optarg;
 				break;
+			case 'g':
+				gap = atoi(optarg);
+				if (gap < 0) gap = 0;
+				if (gap > 100) gap = 100;
+				break;
+			case 'S':
+				sparse = true;
+				break;
+			case 'x':
+				sparsefile = optarg;
+				break;
+			case 'R':
+				stress.rate_start = atof(optarg);
+				stress.rate_end = stress.rate_start;
+				if (strchr(optarg, ':') != NULL)
+					stress.rate_end = atof(strchr(optarg, ':') + 1);
+				break;
+			case 'D':
+				stress.duration = atof(optarg);
+				break;
+			case 'P':
+				stress.pool = atoi(optarg);
+				break;
+			case 'm':
+				manifest = optarg;
+				break;
+			case 'M':
+				sitefile = optarg;
+				break;
+			case 'T':
+				tracefile = optarg;
+				break;
 			case 'h':
                 usage();
                 return EXIT_SUCCESS;
@@ -194,17 +393,93 @@ int main(int argc, char** argv) {
 	printf("%Ld\n", txcfg.lo_hz);
   
     signal(SIGINT, handle_sig);
-    
+
+	if (tracefile != NULL) {
+#ifdef ENABLE_TRACE
+		if (trace_open(tracefile) == 0)
+			trace_thread_name("main");
+#else
+		printf("Warning: trace support not built, use make TRACE=1\n");
+#endif
+	}
+
+	if (sitefile != NULL) {
+		struct mlat_site *sites;
+		struct mlat_aircraft aircraft = {icao, lat, lon, alt, 100, name,
+			gap * SAMPLES_PER_US, 0, txcfg.fs_hz};
+		int nsites, i, ret;
+		if (outfile == NULL || name == NULL || path != NULL) {
+			printf("Error: MLAT mode needs -o and -I, and no -t\n");
+			usage();
+			return EXIT_FAILURE;
+		}
+		nsites = mlat_read_sites(sitefile, &sites);
+		if (nsites < 0)
+			return EXIT_FAILURE;
+		printf("MLAT rendering for %d sites\n", nsites);
+		for (i = 0; i < nsites; i++)
+			printf("  %s.%d: %f %f %.1fm\n", outfile, i,
+				sites[i].lat, sites[i].lon, sites[i].alt);
+		ret = mlat_render(sites, nsites, outfile, (double)txcfg.fs_hz, 4096,
+			mlat_aircraft_block, &aircraft, sparse, &stop);
+		free(sites);
+		printf("Done.\n");
+		return (ret < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if ((tstart > 0 || tend != UINT64_MAX) && (path == NULL || tstart > tend)) {
+		printf("Error: -B and -E need -t, and start before end\n");
+		usage();
+		return EXIT_FAILURE;
+	}
+
     if( path != NULL ) {
     	fp = fopen(path, "r");
     	if (fp==NULL) {
     	    fprintf(stderr, "ERROR: Failed to open TX file: %s\n", path);
     	    return EXIT_FAILURE;
     	}
+		/* jump close to the start date instead of reading up to it */
+		if (tstart > 0 && replay_seek(fp, path, tstart) < 0)
+			return EXIT_FAILURE;
     }
 
-	short *ptx_buffer;
-    int32_t ntx = 0;
+	if (stress.rate_start > 0) {
+		if (stress.rate_end <= 0 || stress.duration <= 0 || stress.pool <= 0 ||
+				path != NULL || sparsefile != NULL) {
+			printf("Error: invalid stress mode parameters\n");
+			usage();
+			return EXIT_FAILURE;
+		}
+		stress.lat = lat;
+		stress.lon = lon;
+		stress.fs = txcfg.fs_hz;
+		if (manifest != NULL) {
+			stress.manifest = fopen(manifest, "w+");
+			if (stress.manifest == NULL) {
+				printf("Error: fail to open %s\n", manifest);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (sparse && outfile == NULL) {
+		printf("Error: -S needs -o\n");
+		usage();
+		return EXIT_FAILURE;
+	}
+	if (sparsefile != NULL) {
+		if (sparse || path != NULL) {
+			printf("Error: -x can't be used with -S or -t\n");
+			usage();
+			return EXIT_FAILURE;
+		}
+		sparse_in = sparse_reader_open(sparsefile);
+		if (sparse_in == NULL)
+			return EXIT_FAILURE;
+	}
+
+	int16_t *ptx_buffer;
     
 	if (outfile == NULL) {
     	printf("* Acquiring IIO context\n");
@@ -299,66 +574,122 @@ int main(int argc, char** argv) {
     	    iio_device_find_channel(iio_context_find_device(ctx, "ad9361-phy"), "altvoltage1", true)
     	    , "powerdown", false); // Turn ON TX LO
 
-    	ptx_buffer = (short *)iio_buffer_start(tx_buffer);
+    	ptx_buffer = (int16_t *)iio_buffer_start(tx_buffer);
+		memset(ptx_buffer, 0, BUFFER_SIZE);
+		output.tx_buffer = tx_buffer;
 	} else {
-		fout = fopen(outfile, "w+");
-		if (!fout) {
+		if (sparse)
+			sparse_out = sparse_writer_open(outfile, txcfg.fs_hz);
+		else
+			fout = fopen(outfile, "w+");
+		if (!fout && !sparse_out) {
 			printf("Error: fail to open %s\n", outfile);
 			return EXIT_FAILURE;
 		}
-		ptx_buffer = (short *)malloc(4096 * sizeof(short));
+		ptx_buffer = (int16_t *)calloc(1, BUFFER_SIZE);
 		if (!ptx_buffer) {
 			printf("Error: malloc fail\n");
-			fclose(fout);
+			if (fout)
+				fclose(fout);
 			return EXIT_FAILURE;
 		}
+		output.fout = fout;
 	}
 
+	iq_packer_init(&packer, ptx_buffer, NUM_SAMPLES, gap * SAMPLES_PER_US, 4096,
+		tx_send, &output);
+	if (sparse_out)
+		iq_packer_set_sparse(&packer, sparse_out);
+
     printf("* Transmit starts...\n");    
 
 
-	if (fp != NULL) {
+	if (stress.rate_start > 0) {
+		if (stress_run(&stress, &packer, &stop) < 0)
+			status = EXIT_FAILURE;
+	} else if (sparse_in != NULL) {
+		printf("Emit sparse file content\n");
+		int n, lo, hi;
+
+		/* rendered in the packer buffers, so only the span written in a
+		 * reused buffer is cleared; a TX buffer is always sent full, the
+		 * file gets the exact length
+		 */
+		while (!stop) {
+			n = sparse_render(sparse_in, packer.base, NUM_SAMPLES, packer.buf, &lo, &hi);
+			if (n < 0) {
+				printf("Error: fail to read sparse file %s\n", sparsefile);
+				status = EXIT_FAILURE;
+				break;
+			}
+			if (n == 0)
+				break;
+			iq_packer_dirty(&packer, lo, hi);
+			if (iq_packer_push(&packer, (outfile == NULL) ? NUM_SAMPLES : n) < 0) {
+				status = EXIT_FAILURE;
+				break;
+			}
+		}
+		sparse_reader_close(sparse_in);
+	} else if (fp != NULL) {
 		printf("Emit file content\n");
 
 		struct timespec tm;
 		tm.tv_sec = 0;
+		tm.tv_nsec = 0;
 		int lineid = 0;
 		int ret;
 		char buffer[43];
 		uint64_t date, prevdate = 0;
 		uint8_t trame[14]; // 112 bits adsb
-		uint8_t df17_array[256];
 
 		do {
+			TRACE_BEGIN(parse, "parse");
 			buffer[42] = '\0';
 			ret = readline(fp, buffer);
 			if (ret == 0) {
 				printf("fin\n");
 				break;
 			}
-			lineid++;
 
 			parseline(buffer, ret, &date, trame);
+			TRACE_END(parse);
+			/* the index points at or before the start date */
+			if (date < tstart)
+				continue;
+			if (date > tend)
+				break;
+			lineid++;
+			if (lineid == 1)
+				prevdate = date;
 			tm.tv_sec = date - prevdate;
 			prevdate = date;
 
-			if (ret == 42) {
-				frame_1090es_ppm_modulate(trame, NULL, df17_array);
-				prepare_to_send(df17_array, 256, 0, 4096, ptx_buffer);
-
+			/* frames sharing a date are packed in the same buffers,
+			 * send them before waiting for the next date
+			 */
+			if (tm.tv_sec != 0) {
+				if (iq_packer_flush(&packer) < 0) {
+					status = EXIT_FAILURE;
+					break;
+				}
 				if (outfile == NULL) {
-    	    		ntx = iio_buffer_push(tx_buffer);
-    	    		if (ntx < 0) {
-    	    		    printf("Error pushing buf %d\n", (int) ntx);
-    	    		    break;
-    	    		}
-				} else {
-					fwrite(ptx_buffer, sizeof(short), 4096, fout);
+					TRACE_BEGIN(slp, "nanosleep");
+					nanosleep(&tm, NULL);
+					TRACE_END(slp);
 				}
 			}
-			nanosleep(&tm, NULL);
 
+			/* 42: 112 bits frame, 28: 56 bits frame */
+			if (ret == 42 || ret == 28) {
+				if (iq_packer_add(&packer, trame, (ret == 42) ? 112 : 56) < 0) {
+					status = EXIT_FAILURE;
+					break;
+				}
+			}
 		} while (ret != 0);
+		if (status == EXIT_SUCCESS && iq_packer_flush(&packer) < 0)
+			status = EXIT_FAILURE;
     	fclose(fp);
 	} else { /* generate trame */
 		if (name == NULL) {
@@ -376,15 +707,11 @@ int main(int argc, char** argv) {
 		uint8_t nicsb = 0;
 		uint8_t time = 0;
 		uint8_t surface = 0;
-
+		uint8_t df17_even[14], df17_odd[14], ident[14];
 
 		while(!stop) {
-			adsb_encode(ptx_buffer, icao, lat, lon, alt, ca, tc, ss, nicsb, time, surface);
-    	    ntx = iio_buffer_push(tx_buffer);
-    	    if (ntx < 0) {
-    	        printf("Error pushing buf %d\n", (int) ntx);
-    	        break;
-    	    }       
+			df17_pos_rep_encode(df17_even, df17_odd, ca, icao, tc, ss, nicsb, alt, time, lat, lon, surface);
+			adsb_ident_encode(ident, icao, 0, ca, tc, name);
 
 			if (alt == 10000 && direction == 100)
 				direction = -100;
@@ -392,23 +719,29 @@ int main(int argc, char** argv) {
 				direction = 100;
 			alt += direction;
 
-			adsb_airCraftIdent(ptx_buffer, icao, 0, ca, tc, name);
+			/* position even/odd and identification in one buffer */
+			if (iq_packer_add(&packer, df17_even, 112) < 0 ||
+					iq_packer_add(&packer, df17_odd, 112) < 0 ||
+					iq_packer_add(&packer, ident, 112) < 0 ||
+					iq_packer_flush(&packer) < 0) {
+				status = EXIT_FAILURE;
+				break;
+			}
+
 			if (outfile == NULL) {
-    	    	ntx = iio_buffer_push(tx_buffer);
-    	    	if (ntx < 0) {
-    	    	    printf("Error pushing buf %d\n", (int) ntx);
-    	    	    break;
-    	    	}       
+				TRACE_BEGIN(slp, "sleep");
 				sleep(1);
-			} else {
-				fwrite(ptx_buffer, sizeof(short), 4096, fout);
+				TRACE_END(slp);
 			}
 		}
     }
 
-    printf("Done.\n");
+    printf("Done. %llu frames, %lld samples sent\n",
+		(unsigned long long)packer.total, output.samples);
 
 error_exit:
+	if (stress.manifest && fclose(stress.manifest) != 0)
+		status = EXIT_FAILURE;
 	if (outfile == NULL) {
     	iio_channel_attr_write_bool(
     	    iio_device_find_channel(iio_context_find_device(ctx, "ad9361-phy"), "altvoltage1", true)
@@ -419,9 +752,16 @@ error_exit:
     	if (tx0_q) { iio_channel_disable(tx0_q); }
     	if (ctx) { iio_context_destroy(ctx); }
 	} else {
-		fclose(fout);
+		if (sparse_out) {
+			printf("Sparse: %llu events, %llu samples\n",
+				(unsigned long long)sparse_out->hdr.nevents,
+				(unsigned long long)packer.base);
+			sparse_writer_close(sparse_out, packer.base);
+		} else {
+			fclose(fout);
+		}
 		free(ptx_buffer);
 	}
-    return EXIT_SUCCESS;
+    return status;
 }
 
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "adsb_encode.h"
+#include "mlat.h"
+#include "trace.h"
+
+#define SPEED_OF_LIGHT 299792458.0
+/* WGS84 */
+#define WGS84_A 6378137.0
+#define WGS84_E2 6.69437999014e-3
+
+/* state shared by the site threads */
+struct mlat_state {
+	struct mlat_frame frames[2][MLAT_MAX_FRAMES]; /* previous and current block */
+	int nframes[2];
+	int cur;
+	uint64_t base;          /* first sample of the block being rendered */
+	double fs;
+	int16_t amplitude;
+	bool sparse;
+	bool done;
+	int error;
+	pthread_mutex_t ready;  /* held until the barriers are set */
+	pthread_barrier_t start;
+	pthread_barrier_t end;
+};
+
+struct mlat_worker {
+	struct mlat_site *site;
+	struct mlat_state *st;
+};
+
+void mlat_geodetic_to_ecef(double lat, double lon, double alt, double *ecef)
+{
+	double phi = lat * M_PI / 180.0;
+	double lambda = lon * M_PI / 180.0;
+	double n = WGS84_A / sqrt(1.0 - WGS84_E2 * sin(phi) * sin(phi));
+
+	ecef[0] = (n + alt) * cos(phi) * cos(lambda);
+	ecef[1] = (n + alt) * cos(phi) * sin(lambda);
+	ecef[2] = (n * (1.0 - WGS84_E2) + alt) * sin(phi);
+}
+
+static double mlat_distance(double *a, double *b)
+{
+	double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+	return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+int mlat_read_sites(const char *filename, struct mlat_site **sites)
+{
+	char line[256];
+	int nsites = 0;
+	struct mlat_site *s = NULL, *tmp;
+	FILE *fd = fopen(filename, "r");
+	if (!fd) {
+		printf("Error: fail to open %s\n", filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fd) != NULL) {
+		double lat, lon, alt;
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%lf %lf %lf", &lat, &lon, &alt) != 3)
+			continue;
+		tmp = (struct mlat_site *)realloc(s, (nsites + 1) * sizeof(struct mlat_site));
+		if (!tmp) {
+			printf("Error: malloc fail\n");
+			free(s);
+			fclose(fd);
+			return -1;
+		}
+		s = tmp;
+		memset(&s[nsites], 0, sizeof(struct mlat_site));
+		s[nsites].lat = lat;
+		s[nsites].lon = lon;
+		s[nsites].alt = alt;
+		mlat_geodetic_to_ecef(lat, lon, alt, s[nsites].ecef);
+		nsites++;
+	}
+	fclose(fd);
+
+	if (nsites == 0) {
+		printf("Error: no site in %s\n", filename);
+		free(s);
+		return -1;
+	}
+	*sites = s;
+	return nsites;
+}
+
+/* arrival time and amplitude of a frame at a site
+ * rounded as stored in a sparse file, so both outputs give the same IQ
+ */
+static void mlat_arrival(struct mlat_site *site, struct mlat_state *st,
+	struct mlat_frame *frame, double *t, int16_t *amp)
+{
+	double d = mlat_distance(site->ecef, frame->ecef);
+	double a = st->amplitude;
+
+	*t = frame->t + d / SPEED_OF_LIGHT * st->fs;
+	*t = round(*t * SPARSE_FRAC_ONE) / SPARSE_FRAC_ONE;
+	if (d > MLAT_REF_RANGE)
+		a *= MLAT_REF_RANGE / d;
+	*amp = (int16_t)lrint(a);
+}
+
+/* add every frame of the last two blocks reaching the site during the block */
+static void mlat_render_block(struct mlat_site *site, struct mlat_state *st)
+{
+	TRACE_SCOPE("mlat_render_block");
+	int b, i;
+	int64_t lo, hi;
+	double t;
+	int16_t amp;
+
+	/* only clear what the previous block wrote */
+	if (site->hi > site->lo)
+		memset(site->buf + 2 * site->lo, 0, (site->hi - site->lo) * 2 * sizeof(int16_t));
+	site->lo = MLAT_BLOCK_SAMPLES;
+	site->hi = 0;
+
+	for (b = 0; b < 2; b++) {
+		struct mlat_frame *frames = st->frames[b];
+		for (i = 0; i < st->nframes[b]; i++) {
+			mlat_arrival(site, st, &frames[i], &t, &amp);
+			lo = (int64_t)floor(t) - (int64_t)st->base;
+			hi = lo + ADSB_FRAME_SAMPLES(frames[i].nbits) + 1;
+			if (hi <= 0 || lo >= MLAT_BLOCK_SAMPLES)
+				continue;
+			adsb_render_frame(frames[i].msg, frames[i].nbits, t, amp,
+				site->buf, st->base, MLAT_BLOCK_SAMPLES);
+			if (lo < site->lo)
+				site->lo = (lo < 0) ? 0 : lo;
+			if (hi > site->hi)
+				site->hi = (hi > MLAT_BLOCK_SAMPLES) ? MLAT_BLOCK_SAMPLES : hi;
+		}
+	}
+}
+
+struct mlat_event {
+	double t;
+	int16_t amp;
+	struct mlat_frame *frame;
+};
+
+/* record the frames starting in the block, in arrival order */
+static int mlat_record_block(struct mlat_site *site, struct mlat_state *st)
+{
+	TRACE_SCOPE("mlat_record_block");
+	struct mlat_event ev[2 * MLAT_MAX_FRAMES], tmp;
+	int b, i, j, n = 0;
+
+	for (b = 0; b < 2; b++) {
+		for (i = 0; i < st->nframes[b]; i++) {
+			mlat_arrival(site, st, &st->frames[b][i], &ev[n].t, &ev[n].amp);
+			if (ev[n].t < st->base || ev[n].t >= st->base + MLAT_BLOCK_SAMPLES)
+				continue;
+			ev[n].frame = &st->frames[b][i];
+			/* insertion sort, a block holds a few frames */
+			for (j = n; j > 0 && ev[j-1].t > ev[j].t; j--) {
+				tmp = ev[j];
+				ev[j] = ev[j-1];
+				ev[j-1] = tmp;
+			}
+			n++;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (sparse_writer_add(site->sparse, ev[i].t, ev[i].amp,
+				ev[i].frame->msg, ev[i].frame->nbits) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void *mlat_worker_thread(void *arg)
+{
+	struct mlat_worker *w = (struct mlat_worker *)arg;
+	struct mlat_state *st = w->st;
+	size_t nw;
+
+	trace_thread_name("mlat_site");
+	pthread_mutex_lock(&st->ready);
+	pthread_mutex_unlock(&st->ready);
+	while (1) {
+		pthread_barrier_wait(&st->start);
+		if (st->done)
+			break;
+		if (st->sparse) {
+			if (mlat_record_block(w->site, st) < 0)
+				st->error = 1;
+		} else {
+			mlat_render_block(w->site, st);
+			TRACE_BEGIN(wr, "fwrite");
+			nw = fwrite(w->site->buf, 2 * sizeof(int16_t), MLAT_BLOCK_SAMPLES, w->site->fout);
+			TRACE_END(wr);
+			if (nw != MLAT_BLOCK_SAMPLES)
+				st->error = 1;
+		}
+		pthread_barrier_wait(&st->end);
+	}
+	return NULL;
+}
+
+int mlat_render(struct mlat_site *sites, int nsites, const char *prefix, double fs,
+	int16_t amplitude, mlat_block_t block, void *priv, bool sparse, bool *stop)
+{
+	char filename[1024];
+	int i, started = 0, ret = 0;
+	struct mlat_state *st;
+	struct mlat_worker *workers;
+
+	st = (struct mlat_state *)calloc(1, sizeof(struct mlat_state));
+	workers = (struct mlat_worker *)calloc(nsites, sizeof(struct mlat_worker));
+	if (!st || !workers) {
+		printf("Error: malloc fail\n");
+		free(st);
+		free(workers);
+		return -1;
+	}
+	st->fs = fs;
+	st->amplitude = amplitude;
+	st->sparse = sparse;
+
+	for (i = 0; i < nsites; i++) {
+		snprintf(filename, sizeof(filename), "%s.%d", prefix, i);
+		if (sparse)
+			sites[i].sparse = sparse_writer_open(filename, (uint32_t)fs);
+		else
+			sites[i].fout = fopen(filename, "w+");
+		sites[i].buf = (int16_t *)calloc(MLAT_BLOCK_SAMPLES, 2 * sizeof(int16_t));
+		sites[i].lo = 0;
+		sites[i].hi = 0;
+		if ((!sites[i].fout && !sites[i].sparse) || !sites[i].buf) {
+			printf("Error: fail to open %s\n", filename);
+			ret = -1;
+			goto cleanup;
+		}
+		workers[i].site = &sites[i];
+		workers[i].st = st;
+	}
+
+	/* the barriers count the threads actually started, which wait for
+	 * them to be set
+	 */
+	pthread_mutex_init(&st->ready, NULL);
+	pthread_mutex_lock(&st->ready);
+	for (i = 0; i < nsites; i++) {
+		if (pthread_create(&sites[i].thread, NULL, mlat_worker_thread, &workers[i]) != 0) {
+			printf("Error: fail to create site thread\n");
+			ret = -1;
+			break;
+		}
+		started++;
+	}
+	pthread_barrier_init(&st->start, NULL, started + 1);
+	pthread_barrier_init(&st->end, NULL, started + 1);
+	pthread_mutex_unlock(&st->ready);
+
+	while (ret == 0 && !*stop) {
+		/* encoded once, rendered by every site */
+		int next = st->cur ^ 1;
+		st->nframes[next] = block(priv, st->base, st->frames[next], MLAT_MAX_FRAMES);
+		if (st->nframes[next] < 0) {
+			ret = -1;
+			break;
+		}
+		st->cur = next;
+
+		pthread_barrier_wait(&st->start);
+		pthread_barrier_wait(&st->end);
+		if (st->error) {
+			printf("Error: fail to write site output\n");
+			ret = -1;
+			break;
+		}
+		st->base += MLAT_BLOCK_SAMPLES;
+	}
+
+	st->done = true;
+	pthread_barrier_wait(&st->start);
+	for (i = 0; i < started; i++)
+		pthread_join(sites[i].thread, NULL);
+	pthread_barrier_destroy(&st->start);
+	pthread_barrier_destroy(&st->end);
+	pthread_mutex_destroy(&st->ready);
+
+cleanup:
+	for (i = 0; i < nsites; i++) {
+		if (sites[i].fout)
+			fclose(sites[i].fout);
+		if (sites[i].sparse && sparse_writer_close(sites[i].sparse, st->base) < 0)
+			ret = -1;
+		free(sites[i].buf);
+		sites[i].fout = NULL;
+		sites[i].sparse = NULL;
+		sites[i].buf = NULL;
+	}
+	free(workers);
+	free(st);
+	return ret;
+}
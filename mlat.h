@@ -0,0 +1,65 @@
+#ifndef __MLAT_H__
+#define __MLAT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "sparse.h"
+
+/* multi-receiver (MLAT) rendering
+ *
+ * the same traffic is rendered as one IQ stream per receiver site, each
+ * frame delayed (fractional samples) and attenuated by the 3D distance
+ * between the aircraft and the site. Frames are encoded once per block and
+ * shared by the site threads which render the block in parallel.
+ */
+
+/* samples per block, the farthest site must be closer than a block
+ * (65536 samples at 2 MS/s: ~9800 km)
+ */
+#define MLAT_BLOCK_SAMPLES 65536
+/* full amplitude up to this distance [m], 1/d beyond */
+#define MLAT_REF_RANGE 10000.0
+#define MLAT_MAX_FRAMES 256
+
+struct mlat_site {
+	double lat, lon, alt; /* deg, deg, m */
+	double ecef[3];
+	FILE *fout;
+	struct sparse_writer *sparse; /* instead of fout with sparse output */
+	int16_t *buf;         /* one block */
+	int lo, hi;           /* samples of buf written by the last block */
+	pthread_t thread;
+};
+
+/* one frame emitted by an aircraft, shared by every site */
+struct mlat_frame {
+	uint8_t msg[14];
+	int nbits;
+	double t;             /* emission, in samples since stream start */
+	double ecef[3];       /* aircraft position */
+};
+
+/* fill the frames emitted during the block starting at base (in samples)
+ * return the number of frames (at most max)
+ */
+typedef int (*mlat_block_t)(void *priv, uint64_t base, struct mlat_frame *frames, int max);
+
+/* lat, lon in deg, alt in m */
+void mlat_geodetic_to_ecef(double lat, double lon, double alt, double *ecef);
+
+/* read sites from an ascii file, one "lat lon alt" (deg, deg, m) by line,
+ * lines starting with # are ignored
+ * return the number of sites or -1 on error, *sites must be freed
+ */
+int mlat_read_sites(const char *filename, struct mlat_site **sites);
+
+/* render blocks until *stop, or until the frame source fails
+ * site i is written to <prefix>.<i>, as IQ or as a sparse event file
+ * return 0 on success, -1 on error
+ */
+int mlat_render(struct mlat_site *sites, int nsites, const char *prefix, double fs,
+	int16_t amplitude, mlat_block_t block, void *priv, bool sparse, bool *stop);
+
+#endif /* __MLAT_H__ */
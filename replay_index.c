@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "replay_index.h"
+#include "trace.h"
+
+static int replay_index_add(struct replay_index *idx, uint64_t *size,
+	uint64_t date, uint64_t offset)
+{
+	struct replay_index_entry *e;
+
+	if (idx->hdr.nentries == *size) {
+		*size = (*size == 0) ? 1024 : *size * 2;
+		e = (struct replay_index_entry *)realloc(idx->entries,
+			*size * sizeof(struct replay_index_entry));
+		if (!e) {
+			printf("Error: malloc fail\n");
+			return -1;
+		}
+		idx->entries = e;
+	}
+	e = &idx->entries[idx->hdr.nentries++];
+	e->date = date;
+	e->offset = offset;
+	return 0;
+}
+
+/* one pass over the file: an entry at the first line of a new date, once
+ * at least stride bytes after the previous entry
+ */
+static int replay_index_build(struct replay_index *idx, const char *filename)
+{
+	TRACE_SCOPE("replay_index_build");
+	FILE *fd;
+	char line[256];
+	uint64_t offset = 0, size = 0, date, prev = 0;
+	int ret = 0;
+	size_t len;
+	int bol = 1;
+
+	fd = fopen(filename, "r");
+	if (!fd) {
+		printf("Error: fail to open %s\n", filename);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fd) != NULL) {
+		len = strlen(line);
+		/* only the start of a line holds a date */
+		if (bol && line[0] == '@' && sscanf(line + 1, "%12" SCNx64, &date) == 1) {
+			if (idx->hdr.nlines > 0 && date < prev) {
+				printf("Error: %s not in date order (offset %llu)\n",
+					filename, (unsigned long long)offset);
+				ret = -1;
+				break;
+			}
+			if (idx->hdr.nlines == 0) {
+				idx->hdr.first = date;
+				ret = replay_index_add(idx, &size, date, offset);
+			} else if (date != prev &&
+					offset >= idx->entries[idx->hdr.nentries - 1].offset + idx->hdr.stride) {
+				ret = replay_index_add(idx, &size, date, offset);
+			}
+			if (ret < 0)
+				break;
+			idx->hdr.nlines++;
+			idx->hdr.last = date;
+			prev = date;
+		}
+		bol = (len > 0 && line[len - 1] == '\n');
+		offset += len;
+	}
+	fclose(fd);
+	return ret;
+}
+
+static int replay_index_load(struct replay_index *idx, const char *idxname,
+	const struct stat *st)
+{
+	FILE *fd;
+	struct replay_index_header hdr;
+
+	fd = fopen(idxname, "r");
+	if (!fd)
+		return -1;
+	if (fread(&hdr, sizeof(hdr), 1, fd) != 1 ||
+			memcmp(hdr.magic, REPLAY_INDEX_MAGIC, 8) != 0 ||
+			hdr.version != REPLAY_INDEX_VERSION ||
+			hdr.file_size != (uint64_t)st->st_size ||
+			hdr.file_mtime != (int64_t)st->st_mtim.tv_sec ||
+			hdr.file_mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+			hdr.file_ino != (uint64_t)st->st_ino) {
+		fclose(fd);
+		return -1;
+	}
+	idx->entries = (struct replay_index_entry *)malloc(
+		(hdr.nentries ? hdr.nentries : 1) * sizeof(struct replay_index_entry));
+	if (!idx->entries ||
+			fread(idx->entries, sizeof(struct replay_index_entry), hdr.nentries, fd) != hdr.nentries) {
+		free(idx->entries);
+		idx->entries = NULL;
+		fclose(fd);
+		return -1;
+	}
+	fclose(fd);
+	idx->hdr = hdr;
+	return 0;
+}
+
+/* written to a temporary file then renamed, so that concurrent replays of
+ * the same file never read a partial index
+ */
+static int replay_index_save(const struct replay_index *idx, const char *idxname)
+{
+	FILE *fd;
+	char tmpname[1024];
+	int ret = 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.%d", idxname, (int)getpid());
+	fd = fopen(tmpname, "w");
+	if (!fd)
+		return -1;
+	if (fwrite(&idx->hdr, sizeof(idx->hdr), 1, fd) != 1 ||
+			fwrite(idx->entries, sizeof(struct replay_index_entry),
+				idx->hdr.nentries, fd) != idx->hdr.nentries)
+		ret = -1;
+	if (fclose(fd) != 0)
+		ret = -1;
+	if (ret == 0 && rename(tmpname, idxname) != 0)
+		ret = -1;
+	if (ret < 0)
+		unlink(tmpname);
+	return ret;
+}
+
+struct replay_index *replay_index_open(const char *filename, bool rebuild)
+{
+	struct replay_index *idx;
+	struct stat st;
+	char idxname[1024];
+
+	if (stat(filename, &st) != 0) {
+		printf("Error: fail to open %s\n", filename);
+		return NULL;
+	}
+	if (snprintf(idxname, sizeof(idxname), "%s%s", filename, REPLAY_INDEX_SUFFIX)
+			>= (int)sizeof(idxname) - 16) {
+		printf("Error: file name too long %s\n", filename);
+		return NULL;
+	}
+	idx = (struct replay_index *)calloc(1, sizeof(struct replay_index));
+	if (!idx) {
+		printf("Error: malloc fail\n");
+		return NULL;
+	}
+	if (!rebuild && replay_index_load(idx, idxname, &st) == 0)
+		return idx;
+
+	printf("Indexing %s\n", filename);
+	memcpy(idx->hdr.magic, REPLAY_INDEX_MAGIC, 8);
+	idx->hdr.version = REPLAY_INDEX_VERSION;
+	idx->hdr.stride = REPLAY_INDEX_STRIDE;
+	idx->hdr.file_size = st.st_size;
+	idx->hdr.file_mtime = st.st_mtim.tv_sec;
+	idx->hdr.file_mtime_nsec = st.st_mtim.tv_nsec;
+	idx->hdr.file_ino = st.st_ino;
+	if (replay_index_build(idx, filename) < 0) {
+		replay_index_close(idx);
+		return NULL;
+	}
+	/* still usable from memory */
+	if (replay_index_save(idx, idxname) < 0)
+		printf("Warning: fail to write %s\n", idxname);
+	return idx;
+}
+
+uint64_t replay_index_seek(const struct replay_index *idx, uint64_t date)
+{
+	uint64_t lo = 0, hi = idx->hdr.nentries, mid;
+
+	/* last entry dated before date: every line from date follows it, and
+	 * the line found can be checked (see replay_index.h)
+	 */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid].date < date)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo == 0) ? 0 : idx->entries[lo - 1].offset;
+}
+
+void replay_index_close(struct replay_index *idx)
+{
+	if (!idx)
+		return;
+	free(idx->entries);
+	free(idx);
+}
@@ -0,0 +1,62 @@
+#ifndef __REPLAY_INDEX_H__
+#define __REPLAY_INDEX_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* time index of a replay (-t) file
+ *
+ * a sidecar file <filename>.idx maps line dates to byte offsets, so the
+ * replay can start anywhere without parsing what comes before. It is built
+ * in one pass over the file and reused as long as the file inode, size and
+ * modification time (ns) are unchanged. Lines must be in date order.
+ *
+ * layout (host endianness):
+ *   struct replay_index_header
+ *   struct replay_index_entry * nentries, sorted by date and offset
+ */
+
+#define REPLAY_INDEX_MAGIC "ADSBRIDX"
+#define REPLAY_INDEX_VERSION 2
+#define REPLAY_INDEX_SUFFIX ".idx"
+/* at most one entry per 64kB of file */
+#define REPLAY_INDEX_STRIDE 65536
+
+struct replay_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t stride;        /* bytes */
+	uint64_t file_size;     /* of the indexed file */
+	int64_t file_mtime;
+	int64_t file_mtime_nsec;
+	uint64_t file_ino;
+	uint64_t nlines;        /* lines with a date */
+	uint64_t first;         /* date of the first line */
+	uint64_t last;          /* date of the last line */
+	uint64_t nentries;
+};
+
+/* first line of a date */
+struct replay_index_entry {
+	uint64_t date;
+	uint64_t offset;
+};
+
+struct replay_index {
+	struct replay_index_header hdr;
+	struct replay_index_entry *entries;
+};
+
+/* load the index of filename, build (and save) it if missing or stale, or
+ * if rebuild is set (ie. the saved one was found wrong)
+ * return NULL on error
+ */
+struct replay_index *replay_index_open(const char *filename, bool rebuild);
+/* byte offset to read from to get every line dated date or later: a line
+ * dated before date, or the start of the file. If the line found isn't
+ * dated before date, the index is stale.
+ */
+uint64_t replay_index_seek(const struct replay_index *idx, uint64_t date);
+void replay_index_close(struct replay_index *idx);
+
+#endif /* __REPLAY_INDEX_H__ */
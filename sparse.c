@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "adsb_encode.h"
+#include "sparse.h"
+#include "trace.h"
+
+/* longest frame, plus one sample for a fractional start */
+#define SPARSE_MAX_SPAN (ADSB_FRAME_SAMPLES(112) + 1)
+
+struct sparse_writer *sparse_writer_open(const char *filename, uint32_t sample_rate)
+{
+	struct sparse_writer *w = (struct sparse_writer *)calloc(1, sizeof(struct sparse_writer));
+	if (!w) {
+		printf("Error: malloc fail\n");
+		return NULL;
+	}
+	w->fd = fopen(filename, "w+");
+	if (!w->fd) {
+		printf("Error: fail to open %s\n", filename);
+		free(w);
+		return NULL;
+	}
+	memcpy(w->hdr.magic, SPARSE_MAGIC, 8);
+	w->hdr.version = SPARSE_VERSION;
+	w->hdr.sample_rate = sample_rate;
+	/* rewritten with the final counts at close */
+	if (fwrite(&w->hdr, sizeof(w->hdr), 1, w->fd) != 1) {
+		printf("Error: fail to write %s\n", filename);
+		fclose(w->fd);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+int sparse_writer_add(struct sparse_writer *w, double start, int16_t amplitude,
+	uint8_t *frame, int nbits)
+{
+	struct sparse_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.offset = (uint64_t)llround(start * SPARSE_FRAC_ONE);
+	if (ev.offset < w->last) {
+		printf("Error: sparse events out of order\n");
+		return -1;
+	}
+	ev.amplitude = amplitude;
+	ev.nbits = nbits;
+	memcpy(ev.frame, frame, nbits / 8);
+	if (fwrite(&ev, sizeof(ev), 1, w->fd) != 1)
+		return -1;
+	w->last = ev.offset;
+	w->hdr.nevents++;
+	return 0;
+}
+
+int sparse_writer_close(struct sparse_writer *w, uint64_t nsamples)
+{
+	int ret = 0;
+
+	w->hdr.nsamples = nsamples;
+	if (fseeko(w->fd, 0, SEEK_SET) != 0 ||
+			fwrite(&w->hdr, sizeof(w->hdr), 1, w->fd) != 1)
+		ret = -1;
+	if (fclose(w->fd) != 0)
+		ret = -1;
+	free(w);
+	return ret;
+}
+
+struct sparse_reader *sparse_reader_open(const char *filename)
+{
+	struct sparse_reader *r = (struct sparse_reader *)calloc(1, sizeof(struct sparse_reader));
+	if (!r) {
+		printf("Error: malloc fail\n");
+		return NULL;
+	}
+	r->fd = fopen(filename, "r");
+	if (!r->fd) {
+		printf("Error: fail to open %s\n", filename);
+		free(r);
+		return NULL;
+	}
+	if (fread(&r->hdr, sizeof(r->hdr), 1, r->fd) != 1 ||
+			memcmp(r->hdr.magic, SPARSE_MAGIC, 8) != 0 ||
+			r->hdr.version != SPARSE_VERSION) {
+		printf("Error: %s is not a sparse file\n", filename);
+		fclose(r->fd);
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+static int sparse_read_event(struct sparse_reader *r, uint64_t idx, struct sparse_event *ev)
+{
+	if (idx != r->fidx) {
+		if (fseeko(r->fd, sizeof(struct sparse_header) + idx * sizeof(struct sparse_event),
+				SEEK_SET) != 0)
+			return -1;
+	}
+	if (fread(ev, sizeof(*ev), 1, r->fd) != 1)
+		return -1;
+	r->fidx = idx + 1;
+	return 0;
+}
+
+/* first event which may reach sample start */
+static int64_t sparse_find(struct sparse_reader *r, uint64_t start)
+{
+	struct sparse_event ev;
+	uint64_t lo = 0, hi = r->hdr.nevents, mid;
+	uint64_t limit = (start > SPARSE_MAX_SPAN) ?
+		(start - SPARSE_MAX_SPAN) * SPARSE_FRAC_ONE : 0;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (sparse_read_event(r, mid, &ev) < 0)
+			return -1;
+		if (ev.offset < limit)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int sparse_expand(struct sparse_reader *r, uint64_t start, int n, int16_t *out)
+{
+	int lo, hi;
+
+	TRACE_SCOPE("sparse_expand");
+	memset(out, 0, n * 2 * sizeof(int16_t));
+	return sparse_render(r, start, n, out, &lo, &hi);
+}
+
+int sparse_render(struct sparse_reader *r, uint64_t start, int n, int16_t *out,
+	int *lo, int *hi)
+{
+	struct sparse_event ev;
+	uint64_t i, end;
+	int64_t next = -1, s, e;
+
+	TRACE_SCOPE("sparse_render");
+	*lo = 0;
+	*hi = 0;
+
+	if (start >= r->hdr.nsamples)
+		return 0;
+	if (start + n > r->hdr.nsamples)
+		n = r->hdr.nsamples - start;
+	end = start + n;
+
+	/* sequential calls continue where the previous one stopped */
+	if (start != r->pos) {
+		int64_t idx = sparse_find(r, start);
+		if (idx < 0)
+			return -1;
+		r->idx = idx;
+	}
+
+	for (i = r->idx; i < r->hdr.nevents; i++) {
+		if (sparse_read_event(r, i, &ev) < 0)
+			return -1;
+		if (ev.offset >= end * SPARSE_FRAC_ONE)
+			break;
+		adsb_render_frame(ev.frame, ev.nbits, (double)ev.offset / SPARSE_FRAC_ONE,
+			ev.amplitude, out, start, n);
+		s = (int64_t)(ev.offset >> SPARSE_FRAC_BITS) - (int64_t)start;
+		e = s + ADSB_FRAME_SAMPLES(ev.nbits) + 1;
+		if (s < 0)
+			s = 0;
+		if (e > n)
+			e = n;
+		if (s < e) {
+			if (*lo == *hi || s < *lo)
+				*lo = s;
+			if (e > *hi)
+				*hi = e;
+		}
+		/* first frame running over the range, start there next time */
+		if (next < 0 && ev.offset + (uint64_t)SPARSE_MAX_SPAN * SPARSE_FRAC_ONE >
+				end * SPARSE_FRAC_ONE)
+			next = i;
+	}
+	r->idx = (next >= 0) ? (uint64_t)next : i;
+	r->pos = end;
+	return n;
+}
+
+void sparse_reader_close(struct sparse_reader *r)
+{
+	fclose(r->fd);
+	free(r);
+}
@@ -0,0 +1,82 @@
+#ifndef __SPARSE_H__
+#define __SPARSE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* sparse IQ container
+ *
+ * instead of every sample, store one event per frame (start, amplitude,
+ * frame bits) and the stream parameters. The IQ stream, or any part of it,
+ * is regenerated on demand with sparse_expand().
+ *
+ * layout (host endianness, as the binary IQ output):
+ *   struct sparse_header
+ *   struct sparse_event * nevents, sorted by offset
+ */
+
+#define SPARSE_MAGIC "ADSBSPRS"
+#define SPARSE_VERSION 1
+/* event offsets are in 1/65536 sample */
+#define SPARSE_FRAC_BITS 16
+#define SPARSE_FRAC_ONE (1 << SPARSE_FRAC_BITS)
+
+struct sparse_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_rate;   /* Hz */
+	uint64_t nsamples;      /* stream length */
+	uint64_t nevents;
+};
+
+struct sparse_event {
+	uint64_t offset;        /* frame start, in 1/65536 sample */
+	int16_t amplitude;
+	uint8_t nbits;          /* 56 or 112 */
+	uint8_t reserved;
+	uint8_t frame[14];
+	uint8_t pad[6];
+};
+
+struct sparse_writer {
+	FILE *fd;
+	struct sparse_header hdr;
+	uint64_t last;          /* offset of the last event */
+};
+
+struct sparse_reader {
+	FILE *fd;
+	struct sparse_header hdr;
+	uint64_t idx;           /* first event to render for pos */
+	uint64_t pos;           /* end of the last expanded range */
+	uint64_t fidx;          /* event at the file position */
+};
+
+/* return NULL on error */
+struct sparse_writer *sparse_writer_open(const char *filename, uint32_t sample_rate);
+/* add a frame starting at sample start (may be fractional)
+ * events must be added in start order
+ * return 0 on success, -1 on error
+ */
+int sparse_writer_add(struct sparse_writer *w, double start, int16_t amplitude,
+	uint8_t *frame, int nbits);
+/* write the stream length (samples) in the header and close
+ * return 0 on success, -1 on error
+ */
+int sparse_writer_close(struct sparse_writer *w, uint64_t nsamples);
+
+/* return NULL on error */
+struct sparse_reader *sparse_reader_open(const char *filename);
+/* regenerate samples [start, start + n) as I/Q pairs in out
+ * (n * 2 int16), sequential calls don't seek
+ * return number of samples expanded (< n at end of stream), -1 on error
+ */
+int sparse_expand(struct sparse_reader *r, uint64_t start, int n, int16_t *out);
+/* same, but out must already be zeroed: only the frames are added, and
+ * the samples written are [*lo, *hi) (*lo == *hi when none)
+ */
+int sparse_render(struct sparse_reader *r, uint64_t start, int n, int16_t *out,
+	int *lo, int *hi);
+void sparse_reader_close(struct sparse_reader *r);
+
+#endif /* __SPARSE_H__ */
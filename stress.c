@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "adsb_encode.h"
+#include "stress.h"
+#include "trace.h"
+
+/* synthetic ICAO addresses start here */
+#define STRESS_ICAO_BASE 0x700000
+/* a frame which can't start within this delay [s] of its arrival, because
+ * the channel is busy, is dropped
+ */
+#define STRESS_MAX_DELAY 0.001
+
+struct stress_aircraft {
+	struct adsb_position pos;
+	struct adsb_ident id;
+};
+
+/* xorshift, reproducible whatever the libc */
+static uint64_t stress_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+/* uniform in (0, 1] */
+static double stress_uniform(uint64_t *state)
+{
+	return ((stress_rand(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static struct stress_aircraft *stress_pool(struct stress_cfg *cfg, uint64_t *seed)
+{
+	int i;
+	char name[9];
+	struct stress_aircraft *ac = (struct stress_aircraft *)calloc(cfg->pool,
+		sizeof(struct stress_aircraft));
+	if (!ac) {
+		printf("Error: malloc fail\n");
+		return NULL;
+	}
+	for (i = 0; i < cfg->pool; i++) {
+		uint32_t icao = STRESS_ICAO_BASE + i;
+		/* one out of four is a non-transponder (DF18, CF 0) */
+		uint8_t df = (i % 4 == 3) ? 18 : 17;
+		uint8_t ca = (df == 17) ? 5 : 0;
+
+		ac[i].pos.icao = icao;
+		ac[i].pos.lat = cfg->lat + (stress_uniform(seed) - 0.5) * 4.0;
+		ac[i].pos.lon = cfg->lon + (stress_uniform(seed) - 0.5) * 4.0;
+		ac[i].pos.alt = 1000 + 25 * (int)(stress_uniform(seed) * 1500);
+		ac[i].pos.df = df;
+		ac[i].pos.ca = ca;
+		ac[i].pos.tc = 11;
+
+		ac[i].id.icao = icao;
+		ac[i].id.df = df;
+		ac[i].id.ca = ca;
+		snprintf(name, sizeof(name), "TST%05d", i % 100000);
+		memcpy(ac[i].id.name, name, 8);
+	}
+	return ac;
+}
+
+struct stress_stats {
+	uint64_t frames;
+	uint64_t busy;
+	uint64_t late;    /* sent later than their arrival */
+	uint64_t dropped;
+};
+
+/* target: mean requested rate over the interval, cur - prev: what was sent */
+static void stress_report(struct stress_cfg *cfg, double t, double target,
+	struct stress_stats *cur, struct stress_stats *prev, uint64_t samples)
+{
+	printf("%6.1fs target %7.0f msg/s achieved %7.0f msg/s occupancy %5.1f%% delayed %llu dropped %llu\n",
+		t, target, (cur->frames - prev->frames) * cfg->fs / samples,
+		100.0 * (cur->busy - prev->busy) / samples,
+		(unsigned long long)(cur->late - prev->late),
+		(unsigned long long)(cur->dropped - prev->dropped));
+}
+
+int stress_run(struct stress_cfg *cfg, struct iq_packer *p, bool *stop)
+{
+	struct adsb_ctx ctx;
+	struct stress_aircraft *ac;
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+	uint64_t end = (uint64_t)(cfg->duration * cfg->fs);
+	uint64_t second = (uint64_t)cfg->fs;
+	uint64_t max_delay = (uint64_t)(STRESS_MAX_DELAY * cfg->fs);
+	uint64_t at, start, report, rep_start = 0;
+	struct stress_stats cur, prev;
+	double t = 0, t0, t1, rate;
+	FILE *fman = cfg->manifest;
+	uint8_t frame[2][ADSB_FRAME_BYTES];
+	int i, kind, ret = 0;
+
+	memset(&cur, 0, sizeof(cur));
+	memset(&prev, 0, sizeof(prev));
+	adsb_ctx_init(&ctx);
+	ac = stress_pool(cfg, &seed);
+	if (!ac)
+		return -1;
+	if (fman)
+		fprintf(fman, "# sample,time_s,icao,df,type,frame\n");
+
+	printf("Stress: %.0f -> %.0f msg/s in %.1fs, %d aircraft\n",
+		cfg->rate_start, cfg->rate_end, cfg->duration, cfg->pool);
+	report = second;
+
+	while (!*stop) {
+		TRACE_SCOPE("stress_frame");
+		/* next arrival of a Poisson process at the current rate */
+		rate = cfg->rate_start + (cfg->rate_end - cfg->rate_start) * t / cfg->duration;
+		t += -log(stress_uniform(&seed)) / rate;
+		at = (uint64_t)(t * cfg->fs);
+		if (at >= end)
+			break;
+
+		i = stress_rand(&seed) % cfg->pool;
+		/* positions twice as often as identifications */
+		kind = stress_rand(&seed) % 3;
+		if (kind == 2)
+			adsb_encode_ident(&ctx, &ac[i].id, frame[0]);
+		else
+			adsb_encode_position(&ctx, &ac[i].pos, frame[0], frame[1]);
+
+		/* report each elapsed second of timeline, before the frame
+		 * which starts after it
+		 */
+		start = (at > p->next) ? at : p->next;
+		while (start >= report) {
+			t0 = rep_start / cfg->fs;
+			t1 = report / cfg->fs;
+			if (t1 > cfg->duration)
+				t1 = cfg->duration;
+			cur.frames = p->total;
+			cur.busy = p->busy;
+			stress_report(cfg, report / cfg->fs, cfg->rate_start +
+				(cfg->rate_end - cfg->rate_start) * (t0 + t1) / 2 / cfg->duration,
+				&cur, &prev, report - rep_start);
+			prev = cur;
+			rep_start = report;
+			report += second;
+		}
+
+		if (start - at > max_delay) {
+			cur.dropped++;
+			continue;
+		}
+
+		if (iq_packer_add_at(p, at, frame[kind == 1], 112) < 0) {
+			ret = -1;
+			break;
+		}
+		if (p->last != at)
+			cur.late++;
+		if (fman) {
+			uint8_t *f = frame[kind == 1];
+			int b;
+			fprintf(fman, "%llu,%.7f,%06X,%d,%s,", (unsigned long long)p->last,
+				p->last / cfg->fs, ac[i].pos.icao, f[0] >> 3,
+				(kind == 2) ? "ident" : (kind == 1) ? "pos_odd" : "pos_even");
+			for (b = 0; b < ADSB_FRAME_BYTES; b++)
+				fprintf(fman, "%02X", f[b]);
+			fprintf(fman, "\n");
+		}
+	}
+
+	if (ret == 0 && iq_packer_flush(p) < 0)
+		ret = -1;
+	if (p->base > 0)
+		printf("Total: %llu frames in %.2fs, achieved %.0f msg/s occupancy %.1f%% delayed %llu dropped %llu\n",
+			(unsigned long long)p->total, p->base / cfg->fs, p->total * cfg->fs / p->base,
+			100.0 * p->busy / p->base, (unsigned long long)cur.late,
+			(unsigned long long)cur.dropped);
+	if (fman && (fflush(fman) != 0 || ferror(fman))) {
+		printf("Error: fail to write the manifest\n");
+		ret = -1;
+	}
+	free(ac);
+	return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef __STRESS_H__
+#define __STRESS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "iq_packer.h"
+
+/* receiver stress test
+ *
+ * DF17/DF18 traffic from a pool of synthetic aircraft, with random
+ * (Poisson) arrivals at a target rate ramping linearly from rate_start to
+ * rate_end. Frames are placed on the sample timeline by the packer, which
+ * only delays them to keep the minimum gap, so the achieved rate and the
+ * channel occupancy are measured from the emitted timeline and reported
+ * every second. Every frame sent may be logged to a manifest (ground truth).
+ */
+
+struct stress_cfg {
+	double rate_start;    /* msg/s */
+	double rate_end;      /* msg/s */
+	double duration;      /* s */
+	int pool;             /* number of synthetic aircraft */
+	float lat, lon;       /* center of the traffic */
+	double fs;            /* sample rate */
+	FILE *manifest;       /* opened by the caller, may be NULL */
+};
+
+/* generate the traffic through p until duration or *stop
+ * return 0 on success, -1 on error
+ */
+int stress_run(struct stress_cfg *cfg, struct iq_packer *p, bool *stop);
+
+#endif /* __STRESS_H__ */
@@ -0,0 +1,145 @@
+#ifdef ENABLE_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+
+/* one event: complete ('X') or counter ('C') */
+struct trace_event {
+	const char *name;
+	uint64_t ts;
+	uint64_t val; /* duration in ns for 'X', value for 'C' */
+	char type;
+};
+
+struct trace_ring {
+	struct trace_event events[TRACE_RING_SIZE];
+	uint64_t head;
+	int tid;
+	const char *name;
+	struct trace_ring *next;
+};
+
+static FILE *trace_fd = NULL;
+static uint64_t trace_origin;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *trace_rings = NULL;
+static int trace_next_tid = 1;
+static __thread struct trace_ring *ring = NULL;
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* first event of a thread: allocate and register its ring */
+static struct trace_ring *trace_get_ring(void)
+{
+	if (ring)
+		return ring;
+	ring = (struct trace_ring *)calloc(1, sizeof(struct trace_ring));
+	if (!ring)
+		return NULL;
+	pthread_mutex_lock(&trace_lock);
+	ring->tid = trace_next_tid++;
+	ring->next = trace_rings;
+	trace_rings = ring;
+	pthread_mutex_unlock(&trace_lock);
+	return ring;
+}
+
+static void trace_record(char type, const char *name, uint64_t ts, uint64_t val)
+{
+	struct trace_ring *r;
+	struct trace_event *ev;
+
+	if (!trace_fd)
+		return;
+	r = trace_get_ring();
+	if (!r)
+		return;
+	ev = &r->events[r->head & (TRACE_RING_SIZE - 1)];
+	ev->type = type;
+	ev->name = name;
+	ev->ts = ts;
+	ev->val = val;
+	r->head++;
+}
+
+void trace_scope_end(struct trace_scope *scope)
+{
+	trace_record('X', scope->name, scope->start, trace_now() - scope->start);
+}
+
+void trace_counter(const char *name, int64_t value)
+{
+	trace_record('C', name, trace_now(), (uint64_t)value);
+}
+
+void trace_thread_name(const char *name)
+{
+	struct trace_ring *r = trace_get_ring();
+	if (r)
+		r->name = name;
+}
+
+int trace_open(const char *filename)
+{
+	trace_fd = fopen(filename, "w+");
+	if (!trace_fd) {
+		printf("Error: fail to open trace file %s\n", filename);
+		return -1;
+	}
+	trace_origin = trace_now();
+	atexit(trace_dump);
+	return 0;
+}
+
+void trace_dump(void)
+{
+	struct trace_ring *r;
+	uint64_t i, first;
+	int sep = 0;
+	FILE *fd = trace_fd;
+
+	if (!fd)
+		return;
+	/* stop recording before walking the rings */
+	trace_fd = NULL;
+
+	fprintf(fd, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	pthread_mutex_lock(&trace_lock);
+	for (r = trace_rings; r != NULL; r = r->next) {
+		if (r->name) {
+			fprintf(fd, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+				"\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				sep ? ",\n" : "", r->tid, r->name);
+			sep = 1;
+		}
+		first = (r->head > TRACE_RING_SIZE) ? r->head - TRACE_RING_SIZE : 0;
+		for (i = first; i < r->head; i++) {
+			struct trace_event *ev = &r->events[i & (TRACE_RING_SIZE - 1)];
+			/* chrome expects timestamps in us */
+			double ts = (double)(int64_t)(ev->ts - trace_origin) / 1000.0;
+			if (ev->type == 'X')
+				fprintf(fd, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+					"\"ts\":%.3f,\"dur\":%.3f}",
+					sep ? ",\n" : "", ev->name, r->tid, ts, ev->val / 1000.0);
+			else
+				fprintf(fd, "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,"
+					"\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+					sep ? ",\n" : "", ev->name, r->tid, ts, (long long)ev->val);
+			sep = 1;
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	fprintf(fd, "\n]}\n");
+	fclose(fd);
+}
+
+#endif /* ENABLE_TRACE */
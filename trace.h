@@ -0,0 +1,71 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/* scoped trace points dumped as a Chrome trace / Perfetto JSON file
+ *
+ * build with "make TRACE=1" to enable them, otherwise every TRACE_* macro
+ * expands to nothing and costs nothing.
+ *
+ * each thread records into its own ring buffer (no lock on the hot path),
+ * the oldest events are overwritten when the ring is full. All rings are
+ * written to the file given to trace_open() when the program exits.
+ *
+ * TRACE_SCOPE("name");        -> event from here to the end of the block
+ * TRACE_BEGIN(var, "name");   -> explicit begin/end pair
+ * TRACE_END(var);
+ * TRACE_COUNTER("name", val); -> counter track (ie. samples sent)
+ */
+
+#ifdef ENABLE_TRACE
+
+/* events per thread, must be a power of 2 */
+#define TRACE_RING_SIZE (1 << 16)
+
+struct trace_scope {
+	const char *name;
+	uint64_t start;
+};
+
+/* start recording, the file is written at exit
+ * return 0 on success, -1 if the file can't be created
+ */
+int trace_open(const char *filename);
+/* name the calling thread in the viewer */
+void trace_thread_name(const char *name);
+/* write every ring to the file and stop recording */
+void trace_dump(void);
+
+uint64_t trace_now(void);
+void trace_scope_end(struct trace_scope *scope);
+void trace_counter(const char *name, int64_t value);
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+
+#define TRACE_SCOPE(n) \
+	struct trace_scope TRACE_CAT(__trace_scope_, __LINE__) \
+		__attribute__((cleanup(trace_scope_end))) = { (n), trace_now() }
+#define TRACE_BEGIN(v, n) struct trace_scope v = { (n), trace_now() }
+#define TRACE_END(v) trace_scope_end(&(v))
+#define TRACE_COUNTER(n, v) trace_counter((n), (v))
+
+#else
+
+static inline int trace_open(const char *filename)
+{
+	(void)filename;
+	return -1;
+}
+static inline void trace_thread_name(const char *name) { (void)name; }
+static inline void trace_dump(void) {}
+
+#define TRACE_SCOPE(n) do {} while (0)
+#define TRACE_BEGIN(v, n) do {} while (0)
+#define TRACE_END(v) do {} while (0)
+#define TRACE_COUNTER(n, v) do {} while (0)
+
+#endif /* ENABLE_TRACE */
+
+#endif /* __TRACE_H__ */